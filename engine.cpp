@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "engine.hpp"
+#include "protocol.hpp"
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Engine         //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+namespace render_lib {
+
+Status Engine::status_{};
+bool Engine::ready_ = false;
+std::shared_mutex Engine::status_mutex_;
+std::mutex Engine::gate_mutex_;
+std::condition_variable Engine::gate_cv_;
+int Engine::waiting_writer_cnt_ = 0;
+
+Engine::Engine(int max_thread)
+	: max_thread_(std::max(1, max_thread))
+{}
+
+Status Engine::set_status(float fps, int width, int height){
+	if(!(0 < fps) || width <= 0 || height <= 0)
+		throw std::invalid_argument("render_lib::Engine::set_status: fps, width and height must be positive");
+
+	// 待っている間は新しいリクエストを止める (途中で例外が出ても必ず解除する)
+	struct WriterGate {
+		WriterGate(){
+			std::lock_guard<std::mutex> gate_lock(gate_mutex_);
+			++waiting_writer_cnt_;
+		}
+		~WriterGate(){
+			{
+				std::lock_guard<std::mutex> gate_lock(gate_mutex_);
+				--waiting_writer_cnt_;
+			}
+			gate_cv_.notify_all();
+		}
+	} gate;
+
+	std::unique_lock<std::shared_mutex> lock(status_mutex_);
+	ready_ = false;
+	status_ = Status{ 0, fps, 0, 0, height, width };
+	renderer_cpu::init(status_);  // ここで例外が出た場合は ready_ = false のまま
+	ready_ = true;
+
+	// サイズが変わるかもしれないので，この Engine のバッファは作り直す
+	// (排他ロック中なので，貸し出し中のバッファは無い)
+	// 他の Engine のバッファは，次に使う時に render_one で作り直される
+	std::lock_guard<std::mutex> pool_lock(pool_mutex_);
+	pool_.clear();
+	allocated_cnt_ = 0;
+	return status_;
+}
+
+Status Engine::status() const {
+	std::shared_lock<std::shared_mutex> lock(status_mutex_);
+	return status_;
+}
+
+int Engine::frame_count() const {
+	std::shared_lock<std::shared_mutex> lock(status_mutex_);
+	return status_.fps * status_.duration;
+}
+
+std::unique_ptr<cv::Mat> Engine::acquire_buffer(){
+	std::unique_lock<std::mutex> lock(pool_mutex_);
+	// 空きが無く，上限まで確保済みなら返却を待つ
+	pool_cv_.wait(lock, [&]{ return !pool_.empty() || allocated_cnt_ < max_thread_; });
+	if(!pool_.empty()){
+		auto buf = std::move(pool_.back());
+		pool_.pop_back();
+		return buf;
+	}
+	++allocated_cnt_;
+	lock.unlock();
+	try{
+		return std::make_unique<cv::Mat>(cv::Size(status_.width, status_.height), CV_MAKE_TYPE(CV_8U, 4));
+	}catch(...){
+		// 確保に失敗したら枠を返しておく
+		lock.lock();
+		--allocated_cnt_;
+		lock.unlock();
+		pool_cv_.notify_one();
+		throw;
+	}
+}
+
+void Engine::release_buffer(std::unique_ptr<cv::Mat> buf){
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex_);
+		pool_.push_back(std::move(buf));
+	}
+	pool_cv_.notify_one();
+}
+
+void Engine::check_ready() const {
+	if(!ready_)
+		throw std::logic_error("render_lib::Engine: set_status must be called before requesting frames");
+}
+
+// set_status が待っていれば，それが終わるまで待ってから共有ロックを取る
+std::shared_lock<std::shared_mutex> Engine::lock_for_request(){
+	{
+		std::unique_lock<std::mutex> gate_lock(gate_mutex_);
+		gate_cv_.wait(gate_lock, []{ return waiting_writer_cnt_ == 0; });
+	}
+	return std::shared_lock<std::shared_mutex>(status_mutex_);
+}
+
+// status_mutex_ を共有ロックした状態で呼ぶこと
+void Engine::render_one(int frame, const frame_callback& callback){
+	// render やコールバックが例外を投げても，バッファは必ずプールに返す
+	struct BufferGuard {
+		Engine* engine;
+		std::unique_ptr<cv::Mat> buf;
+		~BufferGuard(){ engine->release_buffer(std::move(buf)); }
+	} guard{ this, acquire_buffer() };
+	cv::Mat* buf = guard.buf.get();
+	buf->create(cv::Size(status_.width, status_.height), CV_MAKE_TYPE(CV_8U, 4));  // 大きさが同じなら何もしない
+	buf->setTo(cv::Scalar::all(0));
+
+	Status current_status = status_;
+	current_status.frame = frame;
+	current_status.time  = float(frame) / status_.fps;
+	renderer_cpu::render(*buf, current_status);
+
+	callback(current_status, *buf);
+}
+
+void Engine::request_frame(int frame, const frame_callback& callback){
+	auto lock = lock_for_request();
+	check_ready();
+	render_one(frame, callback);
+}
+
+void Engine::request_range(int begin, int end, const frame_callback& callback){
+	auto lock = lock_for_request();
+	check_ready();
+	if(end <= begin)
+		return;
+
+	// 各スレッドが次のフレームを取りに行く
+	// 例外が出たら残りのフレームは飛ばし，最初の例外だけを覚えておく
+	std::atomic_int next_frame{begin};
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	auto stop = [&](std::exception_ptr e){
+		std::lock_guard<std::mutex> error_lock(error_mutex);
+		if(!error)
+			error = e;
+		next_frame = end;
+	};
+	auto worker = [&]{
+		try{
+			for(int frame; (frame = next_frame++) < end; )
+				render_one(frame, callback);
+		}catch(...){
+			stop(std::current_exception());
+		}
+	};
+
+	std::vector<std::thread> threads;
+	const int thread_cnt = std::min(max_thread_, end - begin);
+	try{
+		for(int i=1; i<thread_cnt; ++i)
+			threads.emplace_back(worker);
+	}catch(...){
+		stop(std::current_exception());  // スレッドが立ち上がらなかった
+	}
+	worker();
+	for(auto& th : threads)
+		th.join();
+	if(error)
+		std::rethrow_exception(error);
+}
+
+}
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Include        //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+#include "main.hpp"
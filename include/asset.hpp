@@ -0,0 +1,183 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <opencv2/opencv.hpp>
+#include "protocol.hpp"
+
+namespace asset {
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Storage        //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// 読み込んだテクスチャ1枚分
+// 全ミップレベルをまとめて1つの mmap 領域に置き，書き込み後は読み取り専用にする
+struct Entry {
+	std::string path;
+	Texture texture{};
+	void* mapped = nullptr;
+	std::size_t mapped_size = 0;
+
+	Entry() = default;
+	Entry(const Entry&) = delete;
+	Entry& operator=(const Entry&) = delete;
+	~Entry(){
+		if(mapped)
+			munmap(mapped, mapped_size);
+	}
+};
+
+// プロセス全体で共有する登録表
+// std::map なので，一度返した Texture への参照は最後まで有効
+inline std::mutex registry_mutex;
+inline std::map<std::string, Entry> registry;
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Mipmap         //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// BGRA (8bit) -> アルファ乗算済み BGRA (float)
+// 縮小時に透明なテクセルの色が混ざって縁が黒ずまないように，乗算済みの状態で縮小する
+inline cv::Mat premultiply(const cv::Mat& src){
+	cv::Mat dst;
+	src.convertTo(dst, CV_32FC4, 1./255);
+	for(int y=0; y<dst.rows; ++y){
+		cv::Vec4f* row = dst.ptr<cv::Vec4f>(y);
+		for(int x=0; x<dst.cols; ++x)
+			for(int c=0; c<3; ++c)
+				row[x][c] *= row[x][3];
+	}
+	return dst;
+}
+
+// アルファ乗算済み BGRA (float) -> BGRA (8bit)
+inline void unpremultiply(const cv::Mat& src, cv::Mat& dst){
+	for(int y=0; y<src.rows; ++y){
+		const cv::Vec4f* in = src.ptr<cv::Vec4f>(y);
+		RGBA* out = dst.ptr<RGBA>(y);
+		for(int x=0; x<src.cols; ++x){
+			const float a = in[x][3];
+			const float k = 0 < a ? 255 / a : 0;
+			using uc = unsigned char;
+			out[x] = RGBA{
+				uc(std::min(255.f, in[x][0]*k + 0.5f)),
+				uc(std::min(255.f, in[x][1]*k + 0.5f)),
+				uc(std::min(255.f, in[x][2]*k + 0.5f)),
+				uc(std::min(255.f, a*255 + 0.5f))
+			};
+		}
+	}
+}
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//         Load          //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// 画像を読み込んで name で登録し，その Texture を返す
+// レンダラの init() から呼ぶこと (render() の中で呼んではいけない)
+// 同じ name・同じ path で既に登録されていれば，読み込み直さずにそれを返す
+// mipmap = true なら，1x1 までの縮小版 (各辺 1/2 ずつ) も作っておく
+// 読み込めなかった場合 (未対応の形式を含む) や，同じ name が別の path で登録済みの場合は std::runtime_error を投げる
+// (render_lib 経由ではホスト側のプロセスで動くので，exit はしない)
+inline const Texture& load(const std::string& name, const std::string& path, bool mipmap = true){
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	if(auto it = registry.find(name); it != registry.end()){
+		if(it->second.path != path)
+			throw std::runtime_error("asset: \"" + name + "\" is already registered as " + it->second.path);
+		return it->second.texture;
+	}
+
+	// デコード (BGRA に揃える)
+	cv::Mat src = cv::imread(path, cv::IMREAD_UNCHANGED);
+	if(src.empty())
+		throw std::runtime_error("asset: failed to load " + path);
+	switch(src.depth()){
+	case CV_8U:
+		break;
+	case CV_16U:
+		src.convertTo(src, CV_8U, 1./257);
+		break;
+	case CV_32F:
+	case CV_64F:
+		src.convertTo(src, CV_8U, 255);  // [0,1] の範囲とみなす (範囲外は飽和する)
+		break;
+	default:
+		// 符号付き整数や半精度などは，どう 8bit にすべきか決まらないので受け付けない
+		throw std::runtime_error("asset: unsupported pixel depth in " + path);
+	}
+	if(src.channels() == 1)
+		cv::cvtColor(src, src, cv::COLOR_GRAY2BGRA);
+	else if(src.channels() == 3)
+		cv::cvtColor(src, src, cv::COLOR_BGR2BGRA);
+
+	// 各レベルの大きさとオフセットを決める
+	Texture tex{};
+	std::size_t offset[Texture::max_level]{};
+	std::size_t total = 0;
+	for(int w = src.cols, h = src.rows; tex.levels < Texture::max_level; w = std::max(1, w/2), h = std::max(1, h/2)){
+		tex.width[tex.levels]  = w;
+		tex.height[tex.levels] = h;
+		offset[tex.levels] = total;
+		total += std::size_t(w) * h * sizeof(RGBA);
+		++tex.levels;
+		if(!mipmap || (w == 1 && h == 1))
+			break;
+	}
+
+	// 書き込み可能で確保し，全レベルを埋めてから読み取り専用にする
+	// 途中で失敗したら登録を取り消す (Entry のデストラクタで munmap される)
+	Entry& entry = registry[name];
+	try{
+		void* mapped = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(mapped == MAP_FAILED)
+			throw std::runtime_error("asset: mmap failed (" + std::to_string(total) + " bytes) for " + path);
+		entry.path = path;
+		entry.mapped = mapped;
+		entry.mapped_size = total;
+
+		unsigned char* base = static_cast<unsigned char*>(mapped);
+		cv::Mat premul;
+		for(int level = 0; level < tex.levels; ++level){
+			cv::Mat dst(tex.height[level], tex.width[level], CV_8UC4, base + offset[level]);
+			if(level == 0)
+				src.copyTo(dst);
+			else{
+				// 縮小は常に乗算済みの1つ上のレベルから行い，8bit に戻すのは書き出す時だけにする
+				if(level == 1)
+					premul = premultiply(src);
+				cv::resize(premul, premul, dst.size(), 0, 0, cv::INTER_AREA);
+				unpremultiply(premul, dst);
+			}
+			tex.data[level] = reinterpret_cast<const RGBA*>(base + offset[level]);
+		}
+	}catch(...){
+		registry.erase(name);
+		throw;
+	}
+	if(mprotect(entry.mapped, total, PROT_READ) != 0){
+		registry.erase(name);
+		throw std::runtime_error("asset: mprotect failed for " + path);
+	}
+	entry.texture = tex;
+	return entry.texture;
+}
+
+// 登録済みのテクスチャを返す
+// 毎ピクセル呼ぶようなものではないので，init() で受け取った参照を保持しておくのが良い
+// 登録されていなければ std::out_of_range を投げる
+inline const Texture& get(const std::string& name){
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	auto it = registry.find(name);
+	if(it == registry.end())
+		throw std::out_of_range("asset: \"" + name + "\" is not registered");
+	return it->second.texture;
+}
+
+}
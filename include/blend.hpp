@@ -159,4 +159,58 @@ GLOBAL_FUNC_PREFIX inline RGBA blend_xor(const RGBA& dst, const RGBA& src){
 	return blend_internal(dst, src, 1-src.a/255.f, 1-dst.a/255.f, internal_source_normal);
 }
 
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Texture        //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// テクスチャは CPU 側のメモリにあるので，以下は CPU からのみ使える
+// u, v は [0,1] (端はクランプ)，level はミップレベル
+
+// 縮小率 (1ピクセルあたりのテクセル数) から使うミップレベルを選ぶ
+inline int mip_level(const Texture& tex, float texel_per_pixel){
+	int level = 0;
+	for(float s = texel_per_pixel; 2 <= s && level+1 < tex.levels; s /= 2)
+		++level;
+	return level;
+}
+
+inline const RGBA& texel(const Texture& tex, int level, int x, int y){
+	const int w = tex.width[level], h = tex.height[level];
+	x = x < 0 ? 0 : (w <= x ? w-1 : x);
+	y = y < 0 ? 0 : (h <= y ? h-1 : y);
+	return tex.data[level][y*w + x];
+}
+
+// 最近傍
+inline RGBA sample_nearest(const Texture& tex, float u, float v, int level = 0){
+	return texel(tex, level, int(std::floor(u * tex.width[level])), int(std::floor(v * tex.height[level])));
+}
+
+// バイリニア
+// 透明な部分の色が滲まないように，アルファを乗算した状態で補間する
+inline RGBA sample_bilinear(const Texture& tex, float u, float v, int level = 0){
+	const float fx = u * tex.width[level]  - 0.5f;
+	const float fy = v * tex.height[level] - 0.5f;
+	const int x = int(std::floor(fx)), y = int(std::floor(fy));
+	const float tx = fx - x, ty = fy - y;
+
+	const RGBA* c[4]{ &texel(tex, level, x, y), &texel(tex, level, x+1, y), &texel(tex, level, x, y+1), &texel(tex, level, x+1, y+1) };
+	const float w[4]{ (1-tx)*(1-ty), tx*(1-ty), (1-tx)*ty, tx*ty };
+
+	float r = 0, g = 0, b = 0, a = 0;
+	for(int i=0; i<4; ++i){
+		const float wa = w[i] * c[i]->a;
+		r += wa * c[i]->r;
+		g += wa * c[i]->g;
+		b += wa * c[i]->b;
+		a += wa;
+	}
+	if(a < 0.5f)
+		return {0, 0, 0, 0};
+	using uc = unsigned char;
+	return { uc(b/a + 0.5f), uc(g/a + 0.5f), uc(r/a + 0.5f), uc(a + 0.5f) };
+}
+
 }
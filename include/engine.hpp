@@ -0,0 +1,84 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "protocol.hpp"
+
+namespace render_lib {
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Engine         //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// 描画済みフレームを受け取るコールバック
+// img はエンジンが持つバッファを借りているだけなので，コールバックを抜けた後に参照してはいけない
+// (必要なら中でコピーすること)
+// request_range では複数のスレッドから同時に，フレーム順とは限らない順番で呼ばれる
+// コールバックの中から request_* / set_status を呼ぶとデッドロックするので呼ばないこと
+// (ロックは全 Engine で共有なので，別の Engine でも同じ．入れ子でロックを取ることになり，バッファも使い切ってしまうため)
+// コールバックが例外を投げた場合は，request_* の呼び出し元に投げ直される
+using frame_callback = std::function<void(const Status& status, const cv::Mat& img)>;
+
+// ファイルを介さずにレンダラを呼び出すためのエンジン
+// 複数のホストスレッドから同時に request_frame / request_range を呼んでも良い
+// レンダラ (renderer_cpu::init / render) の状態はプロセスに1つしか無いので，Status とそのロックも全 Engine で共有する
+// Engine を複数作っても良いが，どれかで set_status を呼ぶと全ての Engine の Status が変わる
+// (バッファプールと max_thread は Engine ごと)
+class Engine {
+public:
+	// max_thread: 同時に描画するフレーム数 (= バッファの数) の上限
+	explicit Engine(int max_thread = std::thread::hardware_concurrency());
+
+	// fps とサイズを設定して renderer_cpu::init を呼ぶ
+	// duration などレンダラが書き換えた値を含む Status を返す
+	// 描画中のリクエストがある場合は，それが終わるまで待つ
+	// 待っている間は新しいリクエストを開始させないので，リクエストが途切れなくても待たされ続けることはない
+	// fps / width / height が正でなければ std::invalid_argument を投げる
+	Status set_status(float fps, int width, int height);
+
+	Status status() const;
+	int frame_count() const;
+
+	// 以下は set_status の前に呼ぶと std::logic_error を投げる
+
+	// 1フレームを呼び出し元のスレッドで描画し，callback に渡す
+	void request_frame(int frame, const frame_callback& callback);
+
+	// [begin, end) のフレームを最大 max_thread 並列で描画し，callback に渡す
+	// 全フレームのコールバックが終わってから返る
+	// 途中で例外が出た場合は残りのフレームを諦め，全スレッドを待ってから最初の例外を投げ直す
+	void request_range(int begin, int end, const frame_callback& callback);
+
+private:
+	std::unique_ptr<cv::Mat> acquire_buffer();
+	void release_buffer(std::unique_ptr<cv::Mat> buf);
+	void render_one(int frame, const frame_callback& callback);
+	void check_ready() const;
+	static std::shared_lock<std::shared_mutex> lock_for_request();
+
+	const int max_thread_;
+
+	// プロセス全体で共有する (renderer_cpu の状態と対応する)
+	static Status status_;
+	static bool ready_;  // set_status が成功したかどうか
+	static std::shared_mutex status_mutex_;  // set_status は排他，リクエストは共有で取る
+
+	// std::shared_mutex は共有ロックが優先されることがあり，set_status が待たされ続けるので，
+	// set_status が待っている間は新しいリクエストを入り口で止める
+	static std::mutex gate_mutex_;
+	static std::condition_variable gate_cv_;
+	static int waiting_writer_cnt_;
+
+	// バッファプール (最大 max_thread_ 枚)
+	std::mutex pool_mutex_;
+	std::condition_variable pool_cv_;
+	std::vector<std::unique_ptr<cv::Mat>> pool_;
+	int allocated_cnt_ = 0;
+};
+
+}
@@ -0,0 +1,299 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <zlib.h>
+
+namespace png_writer {
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Filter         //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// 行フィルタ (PNG仕様の None / Sub / Up / Average / Paeth)
+// 分岐を持たない単純なループにしておき，コンパイラの自動ベクトル化に任せる
+
+inline void filter_none(std::uint8_t* out, const std::uint8_t* cur, const std::uint8_t*, int len, int){
+	for(int i=0; i<len; ++i)
+		out[i] = cur[i];
+}
+
+inline void filter_sub(std::uint8_t* out, const std::uint8_t* cur, const std::uint8_t*, int len, int bpp){
+	for(int i=0; i<bpp; ++i)
+		out[i] = cur[i];
+	for(int i=bpp; i<len; ++i)
+		out[i] = cur[i] - cur[i-bpp];
+}
+
+inline void filter_up(std::uint8_t* out, const std::uint8_t* cur, const std::uint8_t* prev, int len, int){
+	for(int i=0; i<len; ++i)
+		out[i] = cur[i] - prev[i];
+}
+
+inline void filter_average(std::uint8_t* out, const std::uint8_t* cur, const std::uint8_t* prev, int len, int bpp){
+	for(int i=0; i<bpp; ++i)
+		out[i] = cur[i] - (prev[i] >> 1);
+	for(int i=bpp; i<len; ++i)
+		out[i] = cur[i] - ((cur[i-bpp] + prev[i]) >> 1);
+}
+
+inline void filter_paeth(std::uint8_t* out, const std::uint8_t* cur, const std::uint8_t* prev, int len, int bpp){
+	for(int i=0; i<bpp; ++i)
+		out[i] = cur[i] - prev[i];
+	for(int i=bpp; i<len; ++i){
+		const int a = cur[i-bpp], b = prev[i], c = prev[i-bpp];
+		const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2*c);
+		const int pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+		out[i] = cur[i] - pred;
+	}
+}
+
+// フィルタ後の行の「散らばり具合」 (符号付きとみなした絶対値の和)
+// 小さいほど deflate で縮みやすい，という定番のヒューリスティック
+inline std::uint32_t filter_cost(const std::uint8_t* row, int len){
+	std::uint32_t sum = 0;
+	for(int i=0; i<len; ++i){
+		const std::int8_t v = static_cast<std::int8_t>(row[i]);
+		sum += v < 0 ? -v : v;
+	}
+	return sum;
+}
+
+// フィルタの選び方
+// FILTER_NONE ～ FILTER_PAETH は全行で同じフィルタを使う (cv::imwrite の既定は FILTER_SUB)
+// FILTER_ADAPTIVE は行ごとに5種類を全部試して一番良さそうなものを選ぶ (既定)
+enum filter_mode : int {
+	FILTER_NONE     = 0,
+	FILTER_SUB      = 1,
+	FILTER_UP       = 2,
+	FILTER_AVERAGE  = 3,
+	FILTER_PAETH    = 4,
+	FILTER_ADAPTIVE = 5,
+};
+
+// 1行分をフィルタする
+// out[0] にフィルタ種別，out[1..len] にフィルタ後のデータが入る
+// prev は前の行 (先頭行の場合は0で埋まった行) を渡す
+// work は FILTER_ADAPTIVE の時だけ使う作業領域で，5行分 (5*len バイト) 必要
+// (フィルタごとに別の行へ書き出し，最後に一番良かったものだけをコピーする)
+inline void filter_row(std::uint8_t* out, std::uint8_t* work, const std::uint8_t* cur, const std::uint8_t* prev, int len, int bpp, int mode){
+	using filter_func = void(*)(std::uint8_t*, const std::uint8_t*, const std::uint8_t*, int, int);
+	static constexpr filter_func filters[5]{ filter_none, filter_sub, filter_up, filter_average, filter_paeth };
+
+	if(mode != FILTER_ADAPTIVE){
+		out[0] = mode;
+		filters[mode](out+1, cur, prev, len, bpp);
+		return;
+	}
+
+	int best_type = 0;
+	std::uint32_t best_cost = UINT32_MAX;
+	for(int type=0; type<5; ++type){
+		filters[type](work + type*len, cur, prev, len, bpp);
+		const std::uint32_t cost = filter_cost(work + type*len, len);
+		if(cost < best_cost){
+			best_cost = cost;
+			best_type = type;
+		}
+	}
+	out[0] = best_type;
+	std::copy(work + best_type*len, work + (best_type+1)*len, out+1);
+}
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Chunk          //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+inline void put_u32(std::vector<std::uint8_t>& buf, std::uint32_t v){
+	buf.push_back(v >> 24);
+	buf.push_back(v >> 16);
+	buf.push_back(v >>  8);
+	buf.push_back(v);
+}
+
+// PNGチャンク (長さ・種別・データ・CRC) を書き出す
+inline void write_chunk(std::ofstream& ofs, const char type[4], const std::uint8_t* data, std::size_t size){
+	std::vector<std::uint8_t> head;
+	put_u32(head, size);
+	head.insert(head.end(), type, type+4);
+
+	uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+	if(size)
+		crc = crc32(crc, data, size);
+	std::vector<std::uint8_t> tail;
+	put_u32(tail, crc);
+
+	ofs.write(reinterpret_cast<const char*>(head.data()), head.size());
+	ofs.write(reinterpret_cast<const char*>(data), size);
+	ofs.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+}
+
+
+// -+-+-+-+-+-+-+-+-+-+- //
+//        Encode         //
+// -+-+-+-+-+-+-+-+-+-+- //
+
+// 1ブロック分 (連続する数行) を raw deflate で圧縮する
+// 直前のブロックの末尾 32KB を辞書として与えるので，分割しても圧縮率はほぼ落ちない (pigz と同じ方式)
+// 最後のブロック以外は Z_SYNC_FLUSH でバイト境界に揃えて終わらせ，単純に連結できるようにする
+inline bool deflate_block(std::vector<std::uint8_t>& out, const std::uint8_t* dict, std::size_t dict_size, const std::uint8_t* data, std::size_t size, bool last, int level, int strategy){
+	z_stream zs{};
+	if(deflateInit2(&zs, level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+		return false;
+	if(dict_size)
+		deflateSetDictionary(&zs, dict, dict_size);
+
+	out.resize(deflateBound(&zs, size) + 16);
+	zs.next_in   = const_cast<Bytef*>(data);
+	zs.avail_in  = size;
+	zs.next_out  = out.data();
+	zs.avail_out = out.size();
+	const int res = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+	out.resize(out.size() - zs.avail_out);
+	deflateEnd(&zs);
+	return last ? res == Z_STREAM_END : res == Z_OK;
+}
+
+// cv::Mat (CV_8UC3 / CV_8UC4, BGR(A)) を PNG として書き出す
+// 1フレームを thread_cnt 個のブロックに分割し，フィルタと圧縮をそれぞれ並列に行う
+// level / strategy の既定値は cv::imwrite の既定 (level 1, Z_RLE) に合わせ，フィルタは行ごとに選ぶ
+// cv::imwrite と同様，成功したかどうかを返す (スレッドが立ち上がらなかった場合なども false)
+inline bool write(const std::string& file_name, const cv::Mat& img, int thread_cnt = 1, int level = Z_BEST_SPEED, int strategy = Z_RLE, int filter = FILTER_ADAPTIVE){
+	if(img.depth() != CV_8U || (img.channels() != 3 && img.channels() != 4) || img.empty())
+		return false;
+	if(filter < FILTER_NONE || FILTER_ADAPTIVE < filter)
+		return false;
+
+	const int width  = img.cols;
+	const int height = img.rows;
+	const int bpp    = img.channels();
+	const int len    = width * bpp;      // 1行のバイト数 (フィルタ種別を除く)
+	const std::size_t stride = len + 1;  // 1行のバイト数 (フィルタ種別を含む)
+	const int block_cnt = std::max(1, std::min(thread_cnt, height));
+
+	// ブロックごとの担当行 [row_begin[i], row_begin[i+1])
+	std::vector<int> row_begin(block_cnt + 1);
+	for(int i=0; i<=block_cnt; ++i)
+		row_begin[i] = static_cast<long long>(height) * i / block_cnt;
+
+	std::vector<std::uint8_t> filtered(stride * height);
+	std::vector<std::vector<std::uint8_t>> compressed(block_cnt);
+	std::vector<uLong> adler(block_cnt);
+	std::vector<char> ok(block_cnt, 1);
+
+	// 各スレッドで走らせる
+	// 例外 (スレッドの起動失敗やメモリ不足) は外に出さず，起動済みのスレッドを全て待ってから false にする
+	auto run_parallel = [&](auto&& func){
+		std::atomic_bool failed{false};
+		auto guarded = [&](int block){
+			try{
+				func(block);
+			}catch(...){
+				failed = true;
+			}
+		};
+		std::vector<std::thread> threads;
+		try{
+			for(int i=1; i<block_cnt; ++i)
+				threads.emplace_back(guarded, i);
+		}catch(...){
+			failed = true;
+		}
+		if(!failed)
+			guarded(0);
+		for(auto& th : threads)
+			th.join();
+		return !failed;
+	};
+
+	// フィルタ (BGR(A) -> RGB(A) の並べ替えもここで行う)
+	const bool filter_ok = run_parallel([&](int block){
+		std::vector<std::uint8_t> cur(len), prev(len, 0), work(filter == FILTER_ADAPTIVE ? 5*len : 0);
+		auto load_row = [&](std::vector<std::uint8_t>& dst, int y){
+			const std::uint8_t* src = img.ptr<std::uint8_t>(y);
+			for(int x=0; x<width; ++x){
+				dst[x*bpp + 0] = src[x*bpp + 2];
+				dst[x*bpp + 1] = src[x*bpp + 1];
+				dst[x*bpp + 2] = src[x*bpp + 0];
+				if(bpp == 4)
+					dst[x*bpp + 3] = src[x*bpp + 3];
+			}
+		};
+
+		const int y0 = row_begin[block];
+		if(y0 != 0)
+			load_row(prev, y0 - 1);  // 先頭行以外は，前のブロックの最終行を参照する
+		for(int y=y0; y<row_begin[block+1]; ++y){
+			load_row(cur, y);
+			filter_row(filtered.data() + stride*y, work.data(), cur.data(), prev.data(), len, bpp, filter);
+			std::swap(cur, prev);
+		}
+	});
+	if(!filter_ok)
+		return false;
+
+	// 圧縮
+	const bool deflate_ok = run_parallel([&](int block){
+		const std::size_t begin = stride * row_begin[block];
+		const std::size_t end   = stride * row_begin[block+1];
+		const std::size_t dict_size = std::min<std::size_t>(begin, 32768);
+		ok[block] = deflate_block(
+			compressed[block],
+			filtered.data() + begin - dict_size, dict_size,
+			filtered.data() + begin, end - begin,
+			block == block_cnt - 1, level, strategy
+		);
+		adler[block] = adler32(adler32(0, nullptr, 0), filtered.data() + begin, end - begin);
+	});
+	if(!deflate_ok)
+		return false;
+	for(int i=0; i<block_cnt; ++i)
+		if(!ok[i])
+			return false;
+
+	// zlib ストリームのチェックサムはブロックごとの値を結合して求める
+	uLong adler_all = adler[0];
+	for(int i=1; i<block_cnt; ++i){
+		const std::size_t size = stride * (row_begin[i+1] - row_begin[i]);
+		adler_all = adler32_combine(adler_all, adler[i], size);
+	}
+
+	// 書き出し
+	std::ofstream ofs(file_name, std::ios::binary);
+	if(!ofs)
+		return false;
+
+	static constexpr std::uint8_t signature[8]{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	ofs.write(reinterpret_cast<const char*>(signature), 8);
+
+	std::vector<std::uint8_t> ihdr;
+	put_u32(ihdr, width);
+	put_u32(ihdr, height);
+	ihdr.push_back(8);                   // bit depth
+	ihdr.push_back(bpp == 4 ? 6 : 2);    // color type (RGBA / RGB)
+	ihdr.push_back(0);                   // compression
+	ihdr.push_back(0);                   // filter
+	ihdr.push_back(0);                   // interlace
+	write_chunk(ofs, "IHDR", ihdr.data(), ihdr.size());
+
+	// zlib ヘッダ (deflate, 32KB window) + 各ブロック + adler32 を IDAT として並べる
+	static constexpr std::uint8_t zlib_head[2]{ 0x78, 0x9c };
+	write_chunk(ofs, "IDAT", zlib_head, 2);
+	for(int i=0; i<block_cnt; ++i)
+		write_chunk(ofs, "IDAT", compressed[i].data(), compressed[i].size());
+	std::vector<std::uint8_t> zlib_tail;
+	put_u32(zlib_tail, adler_all);
+	write_chunk(ofs, "IDAT", zlib_tail.data(), zlib_tail.size());
+
+	write_chunk(ofs, "IEND", nullptr, 0);
+	return static_cast<bool>(ofs);
+}
+
+}
@@ -25,6 +25,16 @@ struct RGBA_f{
 	float a;
 };
 
+// 読み取り専用のテクスチャ (asset.hpp で読み込む)
+// data[0] が元画像，data[1] 以降が各辺 1/2 ずつのミップレベル
+struct Texture{
+	static constexpr int max_level = 16;
+	int levels;
+	int width[max_level];
+	int height[max_level];
+	const RGBA* data[max_level];
+};
+
 namespace renderer_cpu {
 void init(Status& status);
 void render(cv::Mat& img, const Status status);
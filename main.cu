@@ -10,6 +10,7 @@
 #include <opencv2/opencv.hpp>
 #include <cuda_runtime_api.h>
 #include "util.hpp"
+#include "png_writer.hpp"
 #include "protocol.hpp"
 
 #define cudaAssert(ans) { gpuAssert_impl((ans), __FILE__, __LINE__); }
@@ -69,6 +70,7 @@ int main(int argc, char *argv[]){
 	std::cout << "duration: "  << status.duration << std::endl;
 	std::cout << "width: "     << status.width    << std::endl;
 	std::cout << "height: "    << status.height   << std::endl;
+	std::cout << "png thread:" <<  PNG_THREAD << std::endl;
 
 	std::atomic_int done_frame_cnt{0};
 	int total_frame_cnt = status.fps * status.duration;
@@ -99,7 +101,7 @@ int main(int argc, char *argv[]){
 
 		std::ostringstream file_name;
 		file_name << "png/out_" << zero_ume(frame) << ".png";
-		cv::imwrite(file_name.str(), img);
+		png_writer::write(file_name.str(), img, PNG_THREAD, PNG_LEVEL, PNG_STRATEGY, PNG_FILTER);  // 1フレームを PNG_THREAD 並列で圧縮
 
 		progress_bar(frame, total_frame_cnt);
 	}
@@ -4,9 +4,17 @@
 #include <cmath>
 #include "protocol.hpp"
 #include "blend.hpp"
+#ifndef __CUDACC__
+#include "asset.hpp"  // CPU のみ
+#endif
 
 namespace renderer_cpu {
 
+// 画像を使う場合の例 (asset.hpp)
+// const Texture* logo = nullptr;  // ここで宣言しておき，
+// init() の中で:   logo = &asset::load("logo", "assets/logo.png");  // 全スレッドで共有される
+// render() の中で: col = util::blend_normal(col, util::sample_bilinear(*logo, (x+0.5f)/width, (y+0.5f)/height));
+
 // -+-+-+-+-+-+-+-+-+-+-+- //
 //     CPU / Initialize    //
 // -+-+-+-+-+-+-+-+-+-+-+- //
@@ -6,7 +6,8 @@ mkdir -p build
 rm -rf build/*
 
 pushd build
-cmake .. -DBUILD_CPU=ON -DRENDERER='square_transition' -DMAX_THREAD=8
+# 同時に描画するのは 4 フレームまでにして，各フレームの PNG 圧縮を 4 並列で行う
+cmake .. -DBUILD_CPU=ON -DRENDERER='square_transition' -DMAX_THREAD=4 -DPNG_THREAD=4
 make
 popd
 